@@ -0,0 +1,125 @@
+/* Copyright (C) 2018 Emilis Dambauskas
+   This file is part of the DS1302 Control Utility.
+   Written by Emilis Dambauskas <emilis.d@gmail.com>.
+
+   The DS1302 Control Utility is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The DS1302 Control Utility is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the DS1302 Control Utility; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.
+*/
+/// Notes ----------------------------------------------------------------------
+
+/// Compares the runtime-configured library with the compile-time fixed path
+/// by timing single-register read transactions on the same wiring. Both read
+/// the year register, which does not tick, and must agree on every read.
+///
+/// Usage: ds1302-bench [ ITERATIONS ]
+
+
+/// Defines --------------------------------------------------------------------
+
+#define CLK_PIN_DEFAULT 2
+#define DAT_PIN_DEFAULT 3
+#define CE_PIN_DEFAULT  4
+
+#define DS1302_FIXED_CLK_PIN    CLK_PIN_DEFAULT
+#define DS1302_FIXED_DAT_PIN    DAT_PIN_DEFAULT
+#define DS1302_FIXED_CE_PIN     CE_PIN_DEFAULT
+
+#define ITERATIONS_DEFAULT      10000
+#define BENCH_COMMAND           0x8d    /// Read year
+
+
+/// Includes -------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libds1302.h"
+#include "libds1302_fixed.h"
+
+
+/// Functions ------------------------------------------------------------------
+
+int64_t now_ns( void ){
+
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void print_result( const char *name, long iterations, int64_t elapsed_ns ){
+
+    printf(
+        "%-10s %8ld reads %12.3f ms %10.1f ns/read\n",
+        name,
+        iterations,
+        elapsed_ns / 1e6,
+        (double)elapsed_ns / iterations
+    );
+}
+
+
+/// Main -----------------------------------------------------------------------
+
+int main( int argc, char *argv[] ){
+
+    long iterations = ITERATIONS_DEFAULT;
+    long mismatches = 0;
+    uint8_t expected;
+    int64_t start;
+
+    if( argc > 1 && ( 1 != sscanf( argv[1], "%ld", &iterations ) || iterations < 1 )){
+        printf( "Failed to parse iteration count." );
+        exit( 1 );
+    }
+
+    ds1302_device device = ds1302_setup(
+        CLK_PIN_DEFAULT,
+        DAT_PIN_DEFAULT,
+        CE_PIN_DEFAULT
+    );
+    ds1302_fixed_setup();
+
+    expected = ds1302_read_command( device, BENCH_COMMAND );
+
+    start = now_ns();
+    for( long i=0; i<iterations; i++ ){
+        mismatches += ds1302_read_command( device, BENCH_COMMAND ) != expected;
+    }
+    print_result( "runtime", iterations, now_ns() - start );
+
+    start = now_ns();
+    for( long i=0; i<iterations; i++ ){
+        mismatches += ds1302_fixed_read_command( BENCH_COMMAND ) != expected;
+    }
+    print_result( "fixed", iterations, now_ns() - start );
+
+    if( mismatches ){
+        printf( "ERROR: %ld reads didn't match 0x%x\n", mismatches, expected );
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+/* Copyright (C) 2018 Emilis Dambauskas
+   This file is part of the DS1302 Control Utility.
+   Written by Emilis Dambauskas <emilis.d@gmail.com>.
+
+   The DS1302 Control Utility is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The DS1302 Control Utility is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the DS1302 Control Utility; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.
+*/
+/// Notes ----------------------------------------------------------------------
+
+/// Early-boot clock restore: one burst read of the RTC, then set the system
+/// clock (UTC). No wiringPi, no environment lookups; the wiring is fixed at
+/// build time (see `make restore`).
+
+
+/// Defines --------------------------------------------------------------------
+
+#define BCD( value, mask )  (((( value ) & ( mask )) >> 4 ) * 10 + (( value ) & 0x0f ))
+
+
+/// Includes -------------------------------------------------------------------
+
+#include <stdio.h>
+#include <time.h>
+
+#include "libds1302_fixed.h"
+
+
+/// Main -----------------------------------------------------------------------
+
+int main( void ){
+
+    uint8_t registers[7];
+    struct tm tm = { 0 };
+    struct timespec ts = { 0 };
+
+    ds1302_fixed_setup();
+    ds1302_fixed_read_burst( 0xBF, registers, 7 );
+
+    /// A halted clock does not hold a valid time:
+    if( registers[0] & 0x80 ){
+        printf( "Clock is halted, not setting the system time.\n" );
+        return 2;
+    }
+
+    tm.tm_sec =     BCD( registers[0], 0x70 );
+    tm.tm_min =     BCD( registers[1], 0x70 );
+    if( registers[2] & 0x80 ){
+        /// 12h mode: bit 5 is AM/PM, hours are 1-12:
+        tm.tm_hour = BCD( registers[2], 0x10 ) % 12 + (( registers[2] & 0x20 ) ? 12 : 0 );
+    } else {
+        tm.tm_hour = BCD( registers[2], 0x30 );
+    }
+    tm.tm_mday =    BCD( registers[3], 0x30 );
+    tm.tm_mon =     BCD( registers[4], 0x10 ) - 1;
+    tm.tm_year =    BCD( registers[6], 0xf0 ) + 100;
+
+    if(
+        tm.tm_sec > 59 || tm.tm_min > 59 || tm.tm_hour > 23
+        || tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_mon < 0 || tm.tm_mon > 11
+    ){
+        printf( "Clock holds an invalid date, not setting the system time.\n" );
+        return 2;
+    }
+
+    ts.tv_sec = timegm( &tm );
+
+    if( clock_settime( CLOCK_REALTIME, &ts )){
+        perror( "clock_settime" );
+        return 2;
+    }
+
+    return 0;
+}
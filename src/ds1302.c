@@ -36,9 +36,12 @@
 
 /// Includes -------------------------------------------------------------------
 
+#include <ctype.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "libds1302.h"
 
@@ -51,6 +54,46 @@
 
 #define DEVICE          ds1302_device ds1302_device
 
+#define BATCH_NONE      0
+#define BATCH_READ      1
+#define BATCH_DATE      2
+#define BATCH_MAX_ARGS  8
+
+#define BATCH_SNAPSHOT_AGE  10000000    /// Max age (ns) of a clock read shared by batch reads
+
+#define IMAGE_MAGIC     "DS1302"
+#define IMAGE_VERSION   1
+
+#define WATCH_BUFFER_SIZE   ( 1 << 16 )
+#define WATCH_TICK_MARGIN   10000000    /// Poll continuously this long (ns) before an expected tick
+
+
+/// Structs --------------------------------------------------------------------
+
+/// Fixed-size binary sample written by `ds1302 watch ... binary` (host byte order):
+typedef struct watch_record {
+
+    int64_t realtime_ns     ;
+    int64_t monotonic_ns    ;
+    uint8_t year            ;
+    uint8_t month           ;
+    uint8_t mday            ;
+    uint8_t hours           ;
+    uint8_t minutes         ;
+    uint8_t seconds         ;
+    uint8_t weekday         ;
+    uint8_t clock_halt      ;
+} watch_record;
+
+
+/// Variables ------------------------------------------------------------------
+
+#ifdef DS1302_TRACE
+static char *trace_file_name;
+#endif
+
+static volatile sig_atomic_t watch_stopped;
+
 
 /// Functions ------------------------------------------------------------------
 
@@ -73,6 +116,21 @@ uint8_t get_pin( char *pin_name, uint8_t default_value ){
     }
 }
 
+#ifdef DS1302_TRACE
+void write_trace( void ){
+
+    FILE *trace_file = fopen( trace_file_name, "w" );
+
+    if( trace_file == NULL ){
+        fprintf( stderr, "Failed to open trace file %s.", trace_file_name );
+        return;
+    }
+
+    ds1302_trace_dump_vcd( trace_file );
+    fclose( trace_file );
+}
+#endif
+
 
 int do_print_date( DEVICE ){
 
@@ -99,7 +157,9 @@ int do_stop( DEVICE ){
 
 int do_read( DEVICE, int argc, char *argv[] ){
 
-    if( strcmp( argv[2], "year" ) == 0 ){
+    if( argc < 3 ){
+        return do_print_date( ds1302_device );
+    } else if( strcmp( argv[2], "year" ) == 0 ){
         return printf( "20%.2d", DS1302_read_year() );
     } else {
         int value;
@@ -195,6 +255,309 @@ int do_write( DEVICE, int argc, char *argv[] ){
     */
 }
 
+int64_t get_time_ns( clockid_t clock ){
+
+    struct timespec ts;
+
+    clock_gettime( clock, &ts );
+
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void sleep_until_ns( int64_t monotonic_ns ){
+
+    struct timespec ts = {
+        .tv_sec =   monotonic_ns / 1000000000,
+        .tv_nsec =  monotonic_ns % 1000000000
+    };
+
+    clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL );
+}
+
+void stop_watch( int signal ){
+
+    watch_stopped = 1;
+}
+
+void watch_sample( DEVICE, watch_record *record ){
+
+    ds1302_date date;
+
+    record->realtime_ns =   get_time_ns( CLOCK_REALTIME );
+    record->monotonic_ns =  get_time_ns( CLOCK_MONOTONIC );
+
+    DS1302_read_date( &date );
+
+    record->year =          date.year;
+    record->month =         date.month;
+    record->mday =          date.mday;
+    record->hours =         date.hours;
+    record->minutes =       date.minutes;
+    record->seconds =       date.seconds;
+    record->weekday =       date.weekday;
+    record->clock_halt =    date.clock_halt;
+}
+
+void watch_write( watch_record *record, int binary ){
+
+    if( binary ){
+        fwrite( record, sizeof( *record ), 1, stdout );
+    } else {
+        printf(
+            "%" PRId64 ",%" PRId64 ",20%.2d-%.2d-%.2d %.2d:%.2d:%.2d,%d,%d\n",
+            record->realtime_ns,
+            record->monotonic_ns,
+            record->year,
+            record->month,
+            record->mday,
+            record->hours,
+            record->minutes,
+            record->seconds,
+            record->weekday,
+            record->clock_halt
+        );
+    }
+}
+
+int do_watch( DEVICE, int argc, char *argv[] ){
+
+    double rate = 0;
+    int binary = 0;
+    long count = 0;
+
+    if( argc > 5 ){
+        printf( "Too many arguments for watch." );
+        exit( 1 );
+    }
+    if( argc > 2 && strcmp( argv[2], "tick" ) != 0 ){
+        if( 1 != sscanf( argv[2], "%lf", &rate ) || rate <= 0 ){
+            printf( "Failed to parse rate." );
+            exit( 1 );
+        }
+    }
+    if( argc > 3 ){
+        if( !strcmp( argv[3], "binary" )){
+            binary = 1;
+        } else if( strcmp( argv[3], "csv" )){
+            printf( "Unrecognized output format '%s'", argv[3] );
+            exit( 1 );
+        }
+    }
+    if( argc > 4 && ( 1 != sscanf( argv[4], "%ld", &count ) || count < 0 )){
+        printf( "Failed to parse count." );
+        exit( 1 );
+    }
+
+    setvbuf( stdout, NULL, _IOFBF, WATCH_BUFFER_SIZE );
+
+    struct sigaction action = { .sa_handler = stop_watch };
+    sigaction( SIGINT, &action, NULL );
+    sigaction( SIGTERM, &action, NULL );
+
+    if( !binary ){
+        printf( "realtime_ns,monotonic_ns,rtc,weekday,clock_halt\n" );
+    }
+
+    watch_record record, previous;
+    int64_t period_ns = rate > 0 ? (int64_t)( 1e9 / rate ) : 0;
+    int64_t next_ns = get_time_ns( CLOCK_MONOTONIC );
+
+    /// In tick mode, only samples taken right after the seconds change are written:
+    if( !period_ns ){
+        watch_sample( ds1302_device, &previous );
+    }
+
+    for( long written = 0; !watch_stopped && ( !count || written < count ); ){
+
+        watch_sample( ds1302_device, &record );
+
+        if( period_ns ){
+            watch_write( &record, binary );
+            written++;
+            next_ns += period_ns;
+            sleep_until_ns( next_ns );
+        } else if( record.seconds != previous.seconds ){
+            watch_write( &record, binary );
+            written++;
+            previous = record;
+            sleep_until_ns( record.monotonic_ns + 1000000000 - WATCH_TICK_MARGIN );
+        }
+    }
+
+    return fflush( stdout );
+}
+
+/// Restart drift correction from a newly set time:
+void update_drift_epoch( DEVICE, const ds1302_date *date ){
+
+    ds1302_drift drift;
+
+    if( DS1302_read_drift( &drift )){
+        drift.epoch = ds1302_date_to_time( date );
+        DS1302_write_drift( &drift, 0 );
+    }
+}
+
+int do_drift( DEVICE, int argc, char *argv[] ){
+
+    ds1302_drift drift;
+
+    if( argc == 2 ){
+        if( DS1302_read_drift( &drift )){
+            return printf( "%" PRId32 " ppb since %" PRIu32, drift.ppb, drift.epoch );
+        } else {
+            printf( "No drift correction stored." );
+            exit( 2 );
+        }
+    } else if( !strcmp( argv[2], "time" )){
+        time_t corrected = DS1302_read_corrected_time();
+        struct tm tm;
+        char buffer[32];
+
+        gmtime_r( &corrected, &tm );
+        strftime( buffer, sizeof( buffer ), "%Y-%m-%d %H:%M:%S", &tm );
+        return printf( "%s", buffer );
+    } else if( !strcmp( argv[2], "measure" )){
+        uint32_t samples, interval = 1;
+        uint8_t force = 0;
+
+        if( argc > 4 && !strcmp( argv[ argc - 1 ], "force" )){
+            force = 1;
+            argc--;
+        }
+        if( argc < 4 || argc > 5 ){
+            printf( "Usage: ds1302 drift measure SAMPLES [INTERVAL] [force]" );
+            exit( 1 );
+        }
+        if( 1 != sscanf( argv[3], "%" SCNu32, &samples )
+            || ( argc == 5 && 1 != sscanf( argv[4], "%" SCNu32, &interval ))
+        ){
+            printf( "Failed to parse drift measurement arguments." );
+            exit( 1 );
+        }
+        if( !force && !DS1302_drift_ram_free() ){
+            printf( "RAM bytes 0-%d hold other data, use force to overwrite them.", DS1302_DRIFT_RAM_SIZE - 1 );
+            exit( 1 );
+        }
+
+        /// Keep the epoch of the last time the clock was set:
+        DS1302_read_drift( &drift );
+        if( !drift.epoch ){
+            drift.epoch = DS1302_read_corrected_time();
+        }
+        drift.ppb = DS1302_measure_drift( samples, interval );
+
+        if( !DS1302_write_drift( &drift, force )){
+            exit( 2 );
+        }
+        return printf( "%" PRId32 " ppb", drift.ppb );
+    } else {
+        printf( "Unrecognized drift command '%s'", argv[2] );
+        exit( 1 );
+    }
+}
+
+/// Image file: "DS1302", version, payload size, payload (clock registers,
+/// trickle charger, RAM), checksum of the payload.
+uint8_t image_checksum( const uint8_t *payload ){
+
+    uint8_t sum = 0;
+
+    for( uint8_t i=0; i<sizeof( ds1302_image ); i++ ){
+        sum += payload[i];
+    }
+
+    return ~sum;
+}
+
+void save_image( char *file_name, const ds1302_image *image ){
+
+    FILE *file = fopen( file_name, "wb" );
+    uint8_t header[] = { IMAGE_VERSION, sizeof( ds1302_image ) };
+    uint8_t checksum = image_checksum( (const uint8_t *)image );
+
+    if(
+        file == NULL
+        || 1 != fwrite( IMAGE_MAGIC, strlen( IMAGE_MAGIC ), 1, file )
+        || 1 != fwrite( header, sizeof( header ), 1, file )
+        || 1 != fwrite( image, sizeof( ds1302_image ), 1, file )
+        || 1 != fwrite( &checksum, 1, 1, file )
+        || fclose( file )
+    ){
+        printf( "Failed to write image file %s.", file_name );
+        exit( 2 );
+    }
+}
+
+void load_image( char *file_name, ds1302_image *image ){
+
+    FILE *file = fopen( file_name, "rb" );
+    char magic[ sizeof( IMAGE_MAGIC ) - 1 ];
+    uint8_t header[2], checksum;
+
+    if(
+        file == NULL
+        || 1 != fread( magic, sizeof( magic ), 1, file )
+        || 1 != fread( header, sizeof( header ), 1, file )
+    ){
+        printf( "Failed to read image file %s.", file_name );
+        exit( 1 );
+    }
+    if( memcmp( magic, IMAGE_MAGIC, sizeof( magic ))){
+        printf( "Not a DS1302 image file: %s.", file_name );
+        exit( 1 );
+    }
+    if( header[0] != IMAGE_VERSION || header[1] != sizeof( ds1302_image )){
+        printf( "Unsupported image version %d.", header[0] );
+        exit( 1 );
+    }
+    if(
+        1 != fread( image, sizeof( ds1302_image ), 1, file )
+        || 1 != fread( &checksum, 1, 1, file )
+        || checksum != image_checksum( (const uint8_t *)image )
+    ){
+        printf( "Image file %s is damaged.", file_name );
+        exit( 1 );
+    }
+
+    fclose( file );
+}
+
+int do_image( DEVICE, int argc, char *argv[] ){
+
+    ds1302_image image;
+
+    if( argc < 4 ){
+        printf( "Usage: ds1302 image save FILE | ds1302 image apply FILE [keep-time|now|saved-time]" );
+        exit( 1 );
+    } else if( !strcmp( argv[2], "save" ) && argc == 4 ){
+        DS1302_read_image( &image );
+        save_image( argv[3], &image );
+        return 0;
+    } else if( !strcmp( argv[2], "apply" ) && argc <= 5 ){
+        uint8_t flags = DS1302_IMAGE_KEEP_TIME;
+
+        if( argc == 5 ){
+            if( !strcmp( argv[4], "keep-time" )){
+                flags = DS1302_IMAGE_KEEP_TIME;
+            } else if( !strcmp( argv[4], "now" )){
+                flags = DS1302_IMAGE_SET_NOW;
+            } else if( !strcmp( argv[4], "saved-time" )){
+                flags = 0;
+            } else {
+                printf( "Unrecognized image option '%s'", argv[4] );
+                exit( 1 );
+            }
+        }
+
+        load_image( argv[3], &image );
+        return printf( "%d", DS1302_apply_image( &image, flags )) < 0;
+    } else {
+        printf( "Unrecognized image command '%s'", argv[2] );
+        exit( 1 );
+    }
+}
+
 int do_write_date( DEVICE, int argc, char *argv[] ){
 
     uint8_t year, month, mday, hours, minutes, seconds;
@@ -207,7 +570,15 @@ int do_write_date( DEVICE, int argc, char *argv[] ){
     );
 
     if( count == 6 ){
-        return DS1302_write_date( year, month, mday, hours, minutes, seconds );
+        int status = DS1302_write_date( year, month, mday, hours, minutes, seconds );
+        ds1302_date date = {
+            .year = year, .month = month, .mday = mday,
+            .hours = hours, .minutes = minutes, .seconds = seconds
+        };
+
+        update_drift_epoch( ds1302_device, &date );
+
+        return status;
     } else {
         printf( "Failed to parse the given timestamp." );
         exit( 1 );
@@ -215,15 +586,24 @@ int do_write_date( DEVICE, int argc, char *argv[] ){
 }
 
 
-/// Main -----------------------------------------------------------------------
+int do_integrity( DEVICE, int argc, char *argv[] ){
 
-int main( int argc, char *argv[] ){
+    ds1302_integrity stats;
 
-    DEVICE = ds1302_setup(
-        get_pin( "DS1302_CLK_PIN",  CLK_PIN_DEFAULT ),
-        get_pin( "DS1302_DAT_PIN",  DAT_PIN_DEFAULT ),
-        get_pin( "DS1302_CE_PIN",   CE_PIN_DEFAULT )
-    );
+    ds1302_read_integrity( &stats );
+
+    return printf(
+        "reads=%" PRIu32 " disagreements=%" PRIu32 " corrected_bits=%" PRIu32
+        " implausible=%" PRIu32 " confident=%d",
+        stats.reads,
+        stats.disagreements,
+        stats.corrected_bits,
+        stats.implausible,
+        stats.confident
+    ) < 0;
+}
+
+int do_command( DEVICE, int argc, char *argv[] ){
 
     if( argc == 1 ){
         return do_print_date( ds1302_device );
@@ -237,9 +617,219 @@ int main( int argc, char *argv[] ){
                 ? do_read( ds1302_device, argc, argv )
             : !strcmp( argv[1], "write" )
                 ? do_write( ds1302_device, argc, argv )
+            : !strcmp( argv[1], "watch" )
+                ? do_watch( ds1302_device, argc, argv )
+            : !strcmp( argv[1], "drift" )
+                ? do_drift( ds1302_device, argc, argv )
+            : !strcmp( argv[1], "image" )
+                ? do_image( ds1302_device, argc, argv )
+            : !strcmp( argv[1], "integrity" )
+                ? do_integrity( ds1302_device, argc, argv )
             : argc == 2
                 ? do_write_date( ds1302_device, argc, argv )
                 : -1
         );
     }
 }
+
+
+/// Batch ----------------------------------------------------------------------
+
+uint8_t *date_field( ds1302_date *date, char *name ){
+
+    return (
+        !strcmp( name, "year" )
+            ? &date->year
+        : !strcmp( name, "month" )
+            ? &date->month
+        : !strcmp( name, "day" )
+            ? &date->mday
+        : !strcmp( name, "weekday" )
+            ? &date->weekday
+        : !strcmp( name, "hour" )
+            ? &date->hours
+        : !strcmp( name, "hours" )
+            ? &date->hours
+        : !strcmp( name, "minutes" )
+            ? &date->minutes
+        : !strcmp( name, "seconds" )
+            ? &date->seconds
+            : NULL
+    );
+}
+
+/// Which burst transaction a batch command can use:
+int batch_group( int argc, char *argv[] ){
+
+    ds1302_date date;
+
+    if( !strcmp( argv[1], "read" )){
+        return (
+            argc == 2 || ( argc == 3 && date_field( &date, argv[2] ))
+                ? BATCH_READ
+                : BATCH_NONE
+        );
+    } else if( argc == 2 && isdigit( (unsigned char)argv[1][0] )){
+        return BATCH_DATE;
+    } else {
+        return BATCH_NONE;
+    }
+}
+
+void batch_read( ds1302_date *date, int argc, char *argv[] ){
+
+    if( argc == 2 ){
+        printf(
+            "20%.2d-%.2d-%.2d %.2d:%.2d:%.2d\n",
+            date->year,
+            date->month,
+            date->mday,
+            date->hours,
+            date->minutes,
+            date->seconds
+        );
+    } else if( !strcmp( argv[2], "year" )){
+        printf( "20%.2d\n", date->year );
+    } else {
+        printf( "%.2d\n", *date_field( date, argv[2] ));
+    }
+}
+
+/// Sets the whole date with one burst write. Weekday and clock halt are
+/// kept from a read taken right before the write. Write protect is left off,
+/// as ds1302_write_date() does outside batch mode.
+void batch_write_date( DEVICE, char *timestamp ){
+
+    uint8_t year, month, mday, hours, minutes, seconds;
+    ds1302_date date;
+
+    if( 6 != sscanf(
+        timestamp,
+        "20%2hhu-%2hhu-%2hhu%*[T ]%2hhu:%2hhu:%2hhu",
+        &year, &month, &mday, &hours, &minutes, &seconds
+    )){
+        printf( "Failed to parse the given timestamp." );
+        exit( 1 );
+    }
+
+    DS1302_read_date( &date );
+
+    date.year =     year;
+    date.month =    month;
+    date.mday =     mday;
+    date.hours =    hours;
+    date.minutes =  minutes;
+    date.seconds =  seconds;
+
+    DS1302_write_write_protect( 0 );
+    DS1302_write_date_burst( &date );
+    update_drift_epoch( ds1302_device, &date );
+}
+
+/// Runs one command per line. Consecutive clock reads share one burst read
+/// while they arrive within BATCH_SNAPSHOT_AGE of it, and timestamps are set
+/// with one burst write. Single field writes, start and stop are applied
+/// right away, one register each, as outside batch mode.
+int do_batch( DEVICE, int argc, char *argv[] ){
+
+    FILE *input = stdin;
+    char *line = NULL;
+    size_t line_size = 0;
+    ds1302_date date;
+    int64_t snapshot_ns = 0;
+    int group = BATCH_NONE;
+    int status = 0;
+
+    if( argc > 3 ){
+        printf( "Too many arguments for batch." );
+        exit( 1 );
+    }
+    if( argc == 3 && strcmp( argv[2], "-" )){
+        input = fopen( argv[2], "r" );
+        if( input == NULL ){
+            printf( "Failed to open batch file %s.", argv[2] );
+            exit( 1 );
+        }
+    }
+
+    while( getline( &line, &line_size, input ) >= 0 ){
+
+        char *args[ BATCH_MAX_ARGS ] = { argv[0] };
+        int count = 1;
+        char *start = line, *end, *saveptr;
+
+        while( isspace( (unsigned char)*start )){
+            start++;
+        }
+        if( *start == '\0' || *start == '#' ){
+            continue;
+        }
+
+        /// A timestamp is one argument, even if it contains a space:
+        if( isdigit( (unsigned char)*start )){
+            for( end = start + strlen( start ); end > start && isspace( (unsigned char)end[-1] ); end-- );
+            *end = '\0';
+            args[ count++ ] = start;
+        } else {
+            for(
+                char *token = strtok_r( start, " \t\r\n", &saveptr );
+                token != NULL && count < BATCH_MAX_ARGS;
+                token = strtok_r( NULL, " \t\r\n", &saveptr )
+            ){
+                args[ count++ ] = token;
+            }
+        }
+
+        int next_group = batch_group( count, args );
+
+        if( next_group == BATCH_READ ){
+            if(
+                group != BATCH_READ
+                || get_time_ns( CLOCK_MONOTONIC ) - snapshot_ns > BATCH_SNAPSHOT_AGE
+            ){
+                DS1302_read_date( &date );
+                snapshot_ns = get_time_ns( CLOCK_MONOTONIC );
+            }
+            batch_read( &date, count, args );
+        } else if( next_group == BATCH_DATE ){
+            batch_write_date( ds1302_device, args[1] );
+        } else {
+            status = do_command( ds1302_device, count, args );
+            printf( "\n" );
+        }
+        group = next_group;
+    }
+
+    free( line );
+    if( input != stdin ){
+        fclose( input );
+    }
+
+    return status < 0 ? status : 0;
+}
+
+
+/// Main -----------------------------------------------------------------------
+
+int main( int argc, char *argv[] ){
+
+#ifdef DS1302_TRACE
+    trace_file_name = getenv( "DS1302_TRACE_FILE" );
+    if( trace_file_name != NULL ){
+        atexit( write_trace );
+    }
+#endif
+
+    DEVICE = ds1302_setup(
+        get_pin( "DS1302_CLK_PIN",  CLK_PIN_DEFAULT ),
+        get_pin( "DS1302_DAT_PIN",  DAT_PIN_DEFAULT ),
+        get_pin( "DS1302_CE_PIN",   CE_PIN_DEFAULT )
+    );
+    ds1302_device = ds1302_set_votes( ds1302_device, get_pin( "DS1302_VOTES", 1 ));
+
+    if( argc > 1 && !strcmp( argv[1], "batch" )){
+        return do_batch( ds1302_device, argc, argv );
+    } else {
+        return do_command( ds1302_device, argc, argv );
+    }
+}
@@ -28,17 +28,28 @@
 
 /// Defines --------------------------------------------------------------------
 
-#define CE_OFF          digitalWrite( device.ce_pin, LOW )
-#define CE_ON           digitalWrite( device.ce_pin, HIGH )
-
-#define CLK_HI          digitalWrite( device.clk_pin, HIGH )
-#define CLK_LO          digitalWrite( device.clk_pin, LOW )
-
-#define DAT_HI          digitalWrite( device.dat_pin, HIGH )
-#define DAT_INPUT       pinMode( device.dat_pin, INPUT )
-#define DAT_LO          digitalWrite( device.dat_pin, LOW )
-#define DAT_OUTPUT      pinMode( device.dat_pin, OUTPUT )
+#ifdef DS1302_TRACE
+#define TRACE( signal, value )  ds1302_trace_record( DS1302_TRACE_##signal, value )
+#else
+#define TRACE( signal, value )
+#endif
+
+#define CE_OFF          do{ digitalWrite( device.ce_pin, LOW );     TRACE( CE, 0 ); }while( 0 )
+#define CE_ON           do{ digitalWrite( device.ce_pin, HIGH );    TRACE( CE, 1 ); }while( 0 )
+
+#define CLK_HI          do{ digitalWrite( device.clk_pin, HIGH );   TRACE( CLK, 1 ); }while( 0 )
+#define CLK_LO          do{ digitalWrite( device.clk_pin, LOW );    TRACE( CLK, 0 ); }while( 0 )
+
+#define DAT_HI          do{ digitalWrite( device.dat_pin, HIGH );   TRACE( DAT, 1 ); }while( 0 )
+#define DAT_INPUT       do{ pinMode( device.dat_pin, INPUT );       TRACE( DAT_DIR, 0 ); }while( 0 )
+#define DAT_LO          do{ digitalWrite( device.dat_pin, LOW );    TRACE( DAT, 0 ); }while( 0 )
+#define DAT_OUTPUT      do{ pinMode( device.dat_pin, OUTPUT );      TRACE( DAT_DIR, 1 ); }while( 0 )
+
+#ifdef DS1302_TRACE
+#define DAT_READ        ds1302_trace_sample( digitalRead( device.dat_pin ))
+#else
 #define DAT_READ        digitalRead( device.dat_pin )
+#endif
 
 #define DELAY_1         delayMicroseconds( 1 )
 #define DELAY_2         delayMicroseconds( 2 )
@@ -46,11 +57,129 @@
 
 #define DEVICE          ds1302_device device
 
+#define STRETCH_DEFAULT_NS  1000000     /// Default ds1302_read_date_ex() threshold
+
+#define DRIFT_MAGIC         0xD1
+#define DRIFT_TICK_MARGIN   10000000    /// Poll continuously this long (ns) before an expected tick
+
+#ifndef DS1302_TRACE_SIZE
+#define DS1302_TRACE_SIZE   65536   /// Events, must be a power of two
+#endif
+
 /// Includes -------------------------------------------------------------------
 
 #include "libds1302.h"
+#include <string.h>
+#include <time.h>
 #include <wiringPi.h>
 
+#ifdef DS1302_TRACE
+#include <stdatomic.h>
+#endif
+
+
+/// Variables ------------------------------------------------------------------
+
+static ds1302_integrity integrity = { .confident = 1 };
+
+/// Last clock sample accepted by the plausibility check. Like the counters it
+/// is per process, not per device, and is dropped on every clock write:
+static time_t   previous_rtc;
+static int64_t  previous_monotonic_ns;
+static uint8_t  previous_halted = 1;
+
+
+/// Tracing ====================================================================
+
+#ifdef DS1302_TRACE
+
+typedef struct ds1302_trace_event {
+
+    uint64_t    time_ns;
+    uint8_t     signal;
+    uint8_t     value;
+} ds1302_trace_event;
+
+static ds1302_trace_event   trace_events[ DS1302_TRACE_SIZE ];
+static atomic_uint_fast64_t trace_head;
+
+void ds1302_trace_record( uint8_t signal, uint8_t value ){
+
+    struct timespec ts;
+    uint64_t index;
+    ds1302_trace_event *event;
+
+    clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
+
+    index = atomic_fetch_add_explicit( &trace_head, 1, memory_order_relaxed );
+    event = &trace_events[ index & ( DS1302_TRACE_SIZE - 1 ) ];
+
+    event->time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    event->signal = signal;
+    event->value = value;
+}
+
+uint8_t ds1302_trace_sample( uint8_t value ){
+
+    ds1302_trace_record( DS1302_TRACE_DAT_SAMPLE, value );
+
+    return value;
+}
+
+void ds1302_trace_reset( void ){
+
+    atomic_store( &trace_head, 0 );
+}
+
+/// Writes the recorded events as a VCD file. Call while the bus is idle.
+int ds1302_trace_dump_vcd( FILE *file ){
+
+    static const char *names[] = { "ce", "clk", "dat", "dat_dir", "dat_sample" };
+
+    uint64_t head = atomic_load( &trace_head );
+    uint64_t first = head > DS1302_TRACE_SIZE ? head - DS1302_TRACE_SIZE : 0;
+    uint64_t start_ns = 0, last_ns = 0;
+
+    fprintf( file, "$version libds1302 trace $end\n" );
+    fprintf( file, "$timescale 1ns $end\n" );
+    fprintf( file, "$scope module ds1302 $end\n" );
+    for( uint8_t i=0; i<=DS1302_TRACE_DAT_SAMPLE; i++ ){
+        fprintf( file, "$var wire 1 %c %s $end\n", '!' + i, names[i] );
+    }
+    fprintf( file, "$upscope $end\n" );
+    fprintf( file, "$enddefinitions $end\n" );
+    fprintf( file, "$dumpvars\n" );
+    for( uint8_t i=0; i<=DS1302_TRACE_DAT_SAMPLE; i++ ){
+        fprintf( file, "x%c\n", '!' + i );
+    }
+    fprintf( file, "$end\n" );
+
+    for( uint64_t i=first; i<head; i++ ){
+
+        ds1302_trace_event *event = &trace_events[ i & ( DS1302_TRACE_SIZE - 1 ) ];
+
+        if( i == first ){
+            start_ns = event->time_ns;
+        }
+
+        /// Events from concurrent writers may be slightly out of order:
+        uint64_t time_ns = event->time_ns < start_ns ? 0 : event->time_ns - start_ns;
+        if( time_ns < last_ns ){
+            time_ns = last_ns;
+        }
+        if( i == first || time_ns != last_ns ){
+            fprintf( file, "#%" PRIu64 "\n", time_ns );
+        }
+        last_ns = time_ns;
+
+        fprintf( file, "%d%c\n", event->value & 1, '!' + event->signal );
+    }
+
+    return head - first;
+}
+
+#endif // DS1302_TRACE
+
 
 /// Functions ==================================================================
 
@@ -63,6 +192,7 @@ ds1302_device ds1302_setup( uint8_t clk_pin, uint8_t dat_pin, uint8_t ce_pin ){
     device.clk_pin = clk_pin;
     device.dat_pin = dat_pin;
     device.ce_pin =  ce_pin;
+    device.votes =   1;
 
     ds1302_check_device( device );
 
@@ -77,6 +207,23 @@ ds1302_device ds1302_setup( uint8_t clk_pin, uint8_t dat_pin, uint8_t ce_pin ){
     return device;
 }
 
+ds1302_device ds1302_set_votes( DEVICE, uint8_t votes ){
+
+    device.votes = ds1302_check_range( 1, 3, votes );
+
+    return device;
+}
+
+void ds1302_read_integrity( ds1302_integrity *stats ){
+
+    *stats = integrity;
+}
+
+void ds1302_reset_integrity( void ){
+
+    integrity = (ds1302_integrity){ .confident = 1 };
+}
+
 /// Mode change ----------------------------------------------------------------
 
 void ds1302_start_transfer( DEVICE ){
@@ -158,6 +305,73 @@ uint8_t ds1302_read_byte( DEVICE ){
 
 /// Command functions ----------------------------------------------------------
 
+/// Bytes after which a read command repeats: with CE still high, further
+/// SCLK cycles retransmit the data bytes (the whole burst for burst reads).
+static uint8_t ds1302_frame_period( uint8_t command ){
+
+	return ( command & 0xFE ) == DS1302_CLOCK_BURST ? 8
+		: ( command & 0xFE ) == DS1302_RAM_BURST ? 31
+		: 1;
+}
+
+/// Reads the next copy of a frame within the open transaction. Clocking on
+/// to it is cheaper than a new command, unless more than one byte of the
+/// frame period would have to be skipped.
+static void ds1302_read_copy( DEVICE, uint8_t command, uint8_t *copy, uint8_t length ){
+
+	uint8_t skip = ds1302_frame_period( command ) - length;
+
+	if( skip > 1 ){
+		ds1302_stop_transfer( device );
+		ds1302_start_transfer( device );
+		ds1302_start_write( device );
+		ds1302_write_byte( device, command | 0x01 );
+		ds1302_start_read( device );
+	} else if( skip ){
+		ds1302_read_byte( device );
+	}
+
+	for( uint8_t i=0; i<length; i++ ){
+		copy[i] = ds1302_read_byte( device );
+	}
+}
+
+/// Reads more copies of the frame just read into `buffer`, before CE goes
+/// low, and replaces it with the bitwise majority. With 2 votes the third
+/// copy is only read when the first two differ.
+static uint8_t ds1302_vote( DEVICE, uint8_t command, uint8_t *buffer, uint8_t length ){
+
+	uint8_t second[31], third[31];
+	uint8_t disagreed = 0;
+
+	ds1302_check_range( 1, ds1302_frame_period( command ), length );
+
+	ds1302_read_copy( device, command, second, length );
+	integrity.reads++;
+
+	if( device.votes < 3 && !memcmp( buffer, second, length )){
+		integrity.confident = 1;
+		return length;
+	}
+
+	ds1302_read_copy( device, command, third, length );
+
+	for( uint8_t i=0; i<length; i++ ){
+		uint8_t diff = ( buffer[i] ^ second[i] ) | ( buffer[i] ^ third[i] );
+
+		if( diff ){
+			disagreed = 1;
+			integrity.corrected_bits += __builtin_popcount( diff );
+		}
+		buffer[i] = ( buffer[i] & second[i] ) | ( buffer[i] & third[i] ) | ( second[i] & third[i] );
+	}
+
+	integrity.disagreements += disagreed;
+	integrity.confident = !disagreed;
+
+	return length;
+}
+
 uint8_t ds1302_read_command( DEVICE, uint8_t command ){
 
 	uint8_t value;
@@ -170,6 +384,10 @@ uint8_t ds1302_read_command( DEVICE, uint8_t command ){
 
 	value = ds1302_read_byte( device );
 
+	if( device.votes > 1 ){
+		ds1302_vote( device, command, &value, 1 );
+	}
+
 	ds1302_stop_transfer( device );
 
 	return value;
@@ -185,6 +403,11 @@ uint8_t ds1302_write_command( DEVICE, uint8_t command, uint8_t value ){
 
 	ds1302_stop_transfer( device );
 
+	/// Clock registers 0x80-0x8c:
+	if(( command & 0xF0 ) == 0x80 && ( command & 0x0E ) != 0x0E ){
+		previous_halted = 1;
+	}
+
 	return value;
 }
 
@@ -202,6 +425,88 @@ uint8_t ds1302_write_and_check( DEVICE, uint8_t command, uint8_t value ){
 	return value;
 }
 
+uint8_t ds1302_read_burst( DEVICE, uint8_t command, uint8_t *buffer, uint8_t length ){
+
+	ds1302_start_transfer( device );
+	ds1302_start_write( device );
+
+	ds1302_write_byte( device, command | 0x01 );
+	ds1302_start_read( device );
+
+	for( uint8_t i=0; i<length; i++ ){
+		buffer[i] = ds1302_read_byte( device );
+	}
+
+	if( device.votes > 1 ){
+		ds1302_vote( device, command, buffer, length );
+	}
+
+	ds1302_stop_transfer( device );
+
+	return length;
+}
+
+/// Same as ds1302_read_burst(), timestamping CE assert, the end of the command
+/// byte (when the chip latches its registers) and the end of the first frame:
+static uint8_t ds1302_read_burst_timed(
+    DEVICE,
+    uint8_t command,
+    uint8_t *buffer,
+    uint8_t length,
+    ds1302_timing *timing,
+    int64_t threshold_ns
+){
+	struct timespec done;
+
+	CE_ON;
+	clock_gettime( CLOCK_MONOTONIC_RAW, &timing->ce_asserted );
+	DELAY_5;
+	ds1302_start_write( device );
+
+	ds1302_write_byte( device, command | 0x01 );
+	clock_gettime( CLOCK_MONOTONIC_RAW, &timing->command_sent );
+	ds1302_start_read( device );
+
+	for( uint8_t i=0; i<length; i++ ){
+		buffer[i] = ds1302_read_byte( device );
+	}
+
+	/// Vote copies are not part of the timed frame:
+	clock_gettime( CLOCK_MONOTONIC_RAW, &done );
+
+	if( device.votes > 1 ){
+		ds1302_vote( device, command, buffer, length );
+	}
+
+	ds1302_stop_transfer( device );
+
+	timing->duration_ns = (int64_t)( done.tv_sec - timing->ce_asserted.tv_sec ) * 1000000000
+		+ ( done.tv_nsec - timing->ce_asserted.tv_nsec );
+	timing->stretched = timing->duration_ns > ( threshold_ns > 0 ? threshold_ns : STRETCH_DEFAULT_NS );
+
+	return length;
+}
+
+uint8_t ds1302_write_burst( DEVICE, uint8_t command, const uint8_t *buffer, uint8_t length ){
+
+	ds1302_start_transfer( device );
+	ds1302_start_write( device );
+
+	ds1302_write_byte( device, command & 0xFE );
+
+	for( uint8_t i=0; i<length; i++ ){
+		ds1302_write_byte( device, buffer[i] );
+	}
+
+	ds1302_stop_transfer( device );
+
+	if(( command & 0xFE ) == DS1302_CLOCK_BURST ){
+		previous_halted = 1;
+	}
+
+	return length;
+}
+
 
 /// Check functions ------------------------------------------------------------
 
@@ -345,6 +650,160 @@ uint8_t ds1302_read_write_protect( DEVICE ){
     return ( 0x80 & ds1302_read_command( device, 0x8f )) >> 7;
 }
 
+static uint8_t ds1302_decode_hours( uint8_t value ){
+
+    /// 12h mode: bit 5 is AM/PM, hours are 1-12:
+    if( value & 0x80 ){
+        return ds1302_decode( 5, value ) % 12 + (( value & 0x20 ) ? 12 : 0 );
+    } else {
+        return ds1302_decode( 6, value );
+    }
+}
+
+/// Keeps a field of an implausible sample in range, instead of exiting:
+static uint8_t ds1302_clamp( uint8_t min, uint8_t max, uint8_t value ){
+
+    return value < min ? min : value > max ? max : value;
+}
+
+/// Decodes clock registers. Out of range fields exit, unless `clamp` is set.
+static void ds1302_decode_date( const uint8_t *registers, ds1302_date *date, uint8_t clamp ){
+
+    uint8_t (*check)( uint8_t, uint8_t, uint8_t ) = clamp ? ds1302_clamp : ds1302_check_range;
+
+    date->clock_halt =  ( registers[0] & 0x80 ) >> 7;
+    date->seconds =     check( 0, 59, ds1302_decode( 7, registers[0] ));
+    date->minutes =     check( 0, 59, ds1302_decode( 7, registers[1] ));
+    date->hours =       check( 0, 23, ds1302_decode_hours( registers[2] ));
+    date->mday =        check( 1, 31, ds1302_decode( 6, registers[3] ));
+    date->month =       check( 1, 12, ds1302_decode( 5, registers[4] ));
+    date->weekday =     check( 1, 7, ds1302_decode( 3, registers[5] ));
+    date->year =        check( 0, 99, ds1302_decode( 8, registers[6] ));
+}
+
+/// Checks clock registers without exiting: fields in range, and (in
+/// integrity mode) consistent with the time elapsed since the last sample.
+static uint8_t ds1302_plausible_date( DEVICE, const uint8_t *registers ){
+
+    struct timespec ts;
+    int64_t monotonic_ns, elapsed_ns;
+    ds1302_date date;
+    time_t rtc;
+
+    for( uint8_t i=0; i<7; i++ ){
+        if(( registers[i] & 0x0f ) > 9 ){
+            return 0;
+        }
+    }
+
+    date.seconds =  ds1302_decode( 7, registers[0] );
+    date.minutes =  ds1302_decode( 7, registers[1] );
+    date.hours =    ds1302_decode_hours( registers[2] );
+    date.mday =     ds1302_decode( 6, registers[3] );
+    date.month =    ds1302_decode( 5, registers[4] );
+    date.weekday =  ds1302_decode( 3, registers[5] );
+    date.year =     ds1302_decode( 8, registers[6] );
+
+    if(
+        date.seconds > 59 || date.minutes > 59 || date.hours > 23
+        || date.mday < 1 || date.mday > 31 || date.month < 1 || date.month > 12
+        || date.weekday < 1 || date.weekday > 7 || date.year > 99
+    ){
+        return 0;
+    }
+
+    if( device.votes < 2 ){
+        return 1;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    monotonic_ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    elapsed_ns = monotonic_ns - previous_monotonic_ns;
+    rtc = ds1302_date_to_time( &date );
+
+    if( !previous_halted ){
+        int64_t expected_ns = (int64_t)previous_rtc * 1000000000 + elapsed_ns;
+        int64_t error_ns = (int64_t)rtc * 1000000000 - expected_ns;
+
+        /// One second of RTC resolution plus generous drift:
+        if( error_ns < 0 ){
+            error_ns = -error_ns;
+        }
+        if( error_ns > 2000000000 + elapsed_ns / 1000 ){
+            return 0;
+        }
+    }
+
+    previous_rtc = rtc;
+    previous_monotonic_ns = monotonic_ns;
+    previous_halted = ( registers[0] & 0x80 ) >> 7;
+
+    return 1;
+}
+
+/// In integrity mode an implausible sample is read once more. If it is still
+/// implausible it is kept, without confidence, and becomes the new reference
+/// (the clock may have been set). Returns 0 for such a sample, whose fields
+/// must then be clamped rather than range checked. With `timing`, the re-read
+/// is timed too, so the timing always belongs to the returned sample.
+static uint8_t ds1302_check_date(
+    DEVICE,
+    uint8_t *registers,
+    ds1302_timing *timing,
+    int64_t threshold_ns
+){
+
+    if( device.votes < 2 || ds1302_plausible_date( device, registers )){
+        return 1;
+    }
+
+    integrity.implausible++;
+    integrity.confident = 0;
+
+    if( timing ){
+        ds1302_read_burst_timed( device, DS1302_CLOCK_BURST, registers, 7, timing, threshold_ns );
+    } else {
+        ds1302_read_burst( device, DS1302_CLOCK_BURST, registers, 7 );
+    }
+
+    if( !ds1302_plausible_date( device, registers )){
+        previous_halted = 1;
+        ds1302_plausible_date( device, registers );
+        integrity.confident = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+uint8_t ds1302_read_date( DEVICE, ds1302_date *date ){
+
+    uint8_t registers[7];
+
+    ds1302_read_burst( device, DS1302_CLOCK_BURST, registers, 7 );
+    ds1302_decode_date( registers, date, !ds1302_check_date( device, registers, NULL, 0 ));
+
+    return 7;
+}
+
+uint8_t ds1302_read_date_ex(
+    DEVICE,
+    ds1302_date *date,
+    ds1302_timing *timing,
+    int64_t threshold_ns
+){
+    uint8_t registers[7];
+
+    ds1302_read_burst_timed( device, DS1302_CLOCK_BURST, registers, 7, timing, threshold_ns );
+    ds1302_decode_date(
+        registers,
+        date,
+        !ds1302_check_date( device, registers, timing, threshold_ns )
+    );
+
+    return 7;
+}
+
 /// Write commands -------------------------------------------------------------
 
 uint8_t ds1302_write_seconds( DEVICE, uint8_t seconds ){
@@ -441,3 +900,455 @@ uint8_t ds1302_write_date(
         + seconds - ds1302_read_seconds( device )
     );
 }
+
+uint8_t ds1302_write_date_burst( DEVICE, const ds1302_date *date ){
+
+    uint8_t registers[8], check[8];
+    uint8_t wp;
+
+    ds1302_check_range( 0, 59, date->seconds );
+    ds1302_check_range( 0, 59, date->minutes );
+    ds1302_check_range( 0, 23, date->hours );
+    ds1302_check_range( 1, 31, date->mday );
+    ds1302_check_range( 1, 12, date->month );
+    ds1302_check_range( 1, 7, date->weekday );
+    ds1302_check_range( 0, 99, date->year );
+
+    /// Burst writes are ignored while write protect is on:
+    wp = ds1302_read_write_protect( device );
+    if( wp ){
+        ds1302_write_write_protect( device, 0 );
+    }
+
+    registers[0] = (( date->clock_halt & 0x01 ) << 7 ) | ds1302_encode( date->seconds );
+    registers[1] = ds1302_encode( date->minutes );
+    /// Always write hours in 24h format:
+    registers[2] = ds1302_encode( date->hours );
+    registers[3] = ds1302_encode( date->mday );
+    registers[4] = ds1302_encode( date->month );
+    registers[5] = ds1302_encode( date->weekday );
+    registers[6] = ds1302_encode( date->year );
+    registers[7] = wp << 7;
+
+    ds1302_write_burst( device, DS1302_CLOCK_BURST, registers, 8 );
+    ds1302_read_burst( device, DS1302_CLOCK_BURST, check, 8 );
+
+    /// Seconds may have ticked since the write, so they are not compared:
+    for( uint8_t i=1; i<8; i++ ){
+        if( registers[i] != check[i] ){
+            printf( "Values don't match: 0x%x != 0x%x\n", registers[i], check[i] );
+        }
+    }
+
+    return 8;
+}
+
+/// RAM commands ---------------------------------------------------------------
+
+uint8_t ds1302_read_ram( DEVICE, uint8_t address ){
+
+    ds1302_check_range( 0, 30, address );
+
+    return ds1302_read_command( device, 0xc1 + ( address << 1 ));
+}
+
+uint8_t ds1302_write_ram( DEVICE, uint8_t address, uint8_t value ){
+
+    ds1302_check_range( 0, 30, address );
+
+    return ds1302_write_and_check( device, 0xc0 + ( address << 1 ), value );
+}
+
+/// Drift correction -----------------------------------------------------------
+
+static int64_t ds1302_realtime_ns( void ){
+
+    struct timespec ts;
+
+    clock_gettime( CLOCK_REALTIME, &ts );
+
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+time_t ds1302_date_to_time( const ds1302_date *date ){
+
+    struct tm tm = {
+        .tm_year =  100 + date->year,
+        .tm_mon =   date->month - 1,
+        .tm_mday =  date->mday,
+        .tm_hour =  date->hours,
+        .tm_min =   date->minutes,
+        .tm_sec =   date->seconds
+    };
+
+    /// The clock is kept in UTC:
+    return timegm( &tm );
+}
+
+static uint8_t ds1302_drift_checksum( const uint8_t *record ){
+
+    uint8_t sum = 0;
+
+    for( uint8_t i=0; i<DS1302_DRIFT_RAM_SIZE - 1; i++ ){
+        sum += record[i];
+    }
+
+    return ~sum;
+}
+
+static uint8_t ds1302_drift_valid( const uint8_t *record ){
+
+    return record[0] == DRIFT_MAGIC
+        && record[ DS1302_DRIFT_RAM_SIZE - 1 ] == ds1302_drift_checksum( record );
+}
+
+/// The drift record may only replace a record or unused (all zero) RAM:
+uint8_t ds1302_drift_ram_free( DEVICE ){
+
+    uint8_t record[ DS1302_DRIFT_RAM_SIZE ];
+
+    ds1302_read_burst( device, DS1302_RAM_BURST, record, DS1302_DRIFT_RAM_SIZE );
+
+    if( ds1302_drift_valid( record )){
+        return 1;
+    }
+    for( uint8_t i=0; i<DS1302_DRIFT_RAM_SIZE; i++ ){
+        if( record[i] ){
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+uint8_t ds1302_read_drift( DEVICE, ds1302_drift *drift ){
+
+    uint8_t record[ DS1302_DRIFT_RAM_SIZE ];
+
+    ds1302_read_burst( device, DS1302_RAM_BURST, record, DS1302_DRIFT_RAM_SIZE );
+
+    if( !ds1302_drift_valid( record )){
+        drift->ppb = 0;
+        drift->epoch = 0;
+        return 0;
+    }
+
+    drift->ppb = (int32_t)(
+        (uint32_t)record[1]
+        | (uint32_t)record[2] << 8
+        | (uint32_t)record[3] << 16
+        | (uint32_t)record[4] << 24
+    );
+    drift->epoch = (
+        (uint32_t)record[5]
+        | (uint32_t)record[6] << 8
+        | (uint32_t)record[7] << 16
+        | (uint32_t)record[8] << 24
+    );
+
+    return 1;
+}
+
+uint8_t ds1302_write_drift( DEVICE, const ds1302_drift *drift, uint8_t force ){
+
+    uint8_t record[ DS1302_DRIFT_RAM_SIZE ] = {
+        DRIFT_MAGIC,
+        (uint32_t)drift->ppb,
+        (uint32_t)drift->ppb >> 8,
+        (uint32_t)drift->ppb >> 16,
+        (uint32_t)drift->ppb >> 24,
+        drift->epoch,
+        drift->epoch >> 8,
+        drift->epoch >> 16,
+        drift->epoch >> 24
+    };
+    uint8_t check[ DS1302_DRIFT_RAM_SIZE ];
+    uint8_t wp;
+
+    if( !force && !ds1302_drift_ram_free( device )){
+        printf( "RAM bytes 0-%d hold other data, not writing the drift record\n", DS1302_DRIFT_RAM_SIZE - 1 );
+        return 0;
+    }
+
+    wp = ds1302_read_write_protect( device );
+    record[ DS1302_DRIFT_RAM_SIZE - 1 ] = ds1302_drift_checksum( record );
+
+    if( wp ){
+        ds1302_write_write_protect( device, 0 );
+    }
+    ds1302_write_burst( device, DS1302_RAM_BURST, record, DS1302_DRIFT_RAM_SIZE );
+    if( wp ){
+        ds1302_write_write_protect( device, 1 );
+    }
+
+    ds1302_read_burst( device, DS1302_RAM_BURST, check, DS1302_DRIFT_RAM_SIZE );
+    for( uint8_t i=0; i<DS1302_DRIFT_RAM_SIZE; i++ ){
+        if( check[i] != record[i] ){
+            printf( "Drift record doesn't match at RAM byte %d\n", i );
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/// Samples the RTC at `samples` second edges, `interval` seconds apart, against
+/// CLOCK_REALTIME and returns the least-squares rate error in ppb.
+int32_t ds1302_measure_drift( DEVICE, uint32_t samples, uint32_t interval ){
+
+    ds1302_date date;
+    uint8_t previous_seconds;
+    int64_t before_ns, after_ns, first_ns = 0, first_rtc = 0;
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+
+    if( samples < 2 || interval < 1 ){
+        printf( "ERROR: ds1302_measure_drift needs at least 2 samples, 1 second apart\n" );
+        exit( 1 );
+    }
+
+    before_ns = ds1302_realtime_ns();
+    ds1302_read_date( device, &date );
+    previous_seconds = date.seconds;
+
+    for( uint32_t i=0; i<samples; ){
+
+        after_ns = ds1302_realtime_ns();
+        ds1302_read_date( device, &date );
+
+        if( date.seconds == previous_seconds ){
+            before_ns = after_ns;
+            continue;
+        }
+
+        /// The edge happened between the previous poll and this one:
+        int64_t edge_ns = before_ns + ( after_ns - before_ns ) / 2;
+        int64_t rtc = ds1302_date_to_time( &date );
+
+        if( i == 0 ){
+            first_ns = edge_ns;
+            first_rtc = rtc;
+        }
+
+        double x = ( edge_ns - first_ns ) / 1e9;
+        double y = ( rtc - first_rtc ) - x;
+
+        n += 1;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        i++;
+
+        /// Sleep until shortly before the next sampled edge:
+        int64_t sleep_ns = (int64_t)interval * 1000000000
+            - DRIFT_TICK_MARGIN
+            - (int64_t)interval * 100000
+            - ( ds1302_realtime_ns() - edge_ns );
+        if( i < samples && sleep_ns > 0 ){
+            struct timespec ts = {
+                .tv_sec =   sleep_ns / 1000000000,
+                .tv_nsec =  sleep_ns % 1000000000
+            };
+            nanosleep( &ts, NULL );
+        }
+
+        before_ns = ds1302_realtime_ns();
+        ds1302_read_date( device, &date );
+        previous_seconds = date.seconds;
+    }
+
+    double denominator = n * sxx - sx * sx;
+
+    if( denominator <= 0 ){
+        return 0;
+    }
+
+    return (int32_t)(( n * sxy - sx * sy ) / denominator * 1e9 );
+}
+
+time_t ds1302_read_corrected_time( DEVICE ){
+
+    ds1302_date date;
+    ds1302_drift drift;
+
+    ds1302_read_date( device, &date );
+    time_t rtc = ds1302_date_to_time( &date );
+
+    if( !ds1302_read_drift( device, &drift ) || !drift.epoch || rtc < drift.epoch ){
+        return rtc;
+    }
+
+    double correction = ( rtc - (time_t)drift.epoch ) * ( drift.ppb / 1e9 );
+
+    return rtc - (time_t)( correction < 0 ? correction - 0.5 : correction + 0.5 );
+}
+
+/// Device images --------------------------------------------------------------
+
+static uint8_t ds1302_encode_hours( uint8_t hours, uint8_t mode_12h ){
+
+    if( mode_12h ){
+        return 0x80
+            | ( hours >= 12 ? 0x20 : 0 )
+            | ds1302_encode( hours % 12 ? hours % 12 : 12 );
+    } else {
+        return ds1302_encode( hours );
+    }
+}
+
+uint8_t ds1302_read_image( DEVICE, ds1302_image *image ){
+
+    ds1302_read_burst( device, DS1302_CLOCK_BURST, image->clock, 8 );
+    image->trickle_charger = ds1302_read_command( device, 0x91 );
+    ds1302_read_burst( device, DS1302_RAM_BURST, image->ram, 31 );
+
+    return 3;
+}
+
+/// Fills the clock registers to write, taking the time fields from the image,
+/// the chip or the system clock. Returns the number of time registers that
+/// differ from `current`.
+static uint8_t ds1302_image_clock(
+    const uint8_t *current,
+    const ds1302_image *image,
+    uint8_t flags,
+    uint8_t *target
+){
+    uint8_t mode_12h = image->clock[2] & 0x80;
+    uint8_t clock_halt = image->clock[0] & 0x80;
+    uint8_t changed = 0;
+
+    memcpy( target, image->clock, 8 );
+    target[7] &= 0x80;
+
+    /// Time fields, in the hour mode of the image:
+    if( flags & DS1302_IMAGE_SET_NOW ){
+        time_t now = time( NULL );
+        struct tm tm;
+
+        gmtime_r( &now, &tm );
+        target[0] = clock_halt | ds1302_encode( tm.tm_sec > 59 ? 59 : tm.tm_sec );
+        target[1] = ds1302_encode( tm.tm_min );
+        target[2] = ds1302_encode_hours( tm.tm_hour, mode_12h );
+        target[3] = ds1302_encode( tm.tm_mday );
+        target[4] = ds1302_encode( tm.tm_mon + 1 );
+        target[5] = ds1302_encode( tm.tm_wday ? tm.tm_wday : 7 );
+        target[6] = ds1302_encode( tm.tm_year % 100 );
+    } else if( flags & DS1302_IMAGE_KEEP_TIME ){
+        target[0] = clock_halt | ( current[0] & 0x7f );
+        target[2] = ds1302_encode_hours( ds1302_decode_hours( current[2] ), mode_12h );
+        for( uint8_t i=1; i<7; i++ ){
+            if( i != 2 ){
+                target[i] = current[i];
+            }
+        }
+    }
+
+    for( uint8_t i=0; i<7; i++ ){
+        changed += target[i] != current[i];
+    }
+
+    return changed;
+}
+
+/// Writes only the registers that differ from the chip, bursting where that
+/// moves fewer bytes. A valid drift record in RAM is never overwritten: it
+/// belongs to the chip, not to the image. Returns the number of write
+/// transactions.
+uint8_t ds1302_apply_image( DEVICE, const ds1302_image *image, uint8_t flags ){
+
+    ds1302_image current, target = *image, check;
+    uint8_t transactions = 0;
+    uint8_t wp, ram_changed = 0, ram_last = 0, clock_changed = 0;
+
+    ds1302_read_image( device, &current );
+
+    if( ds1302_drift_valid( current.ram )){
+        memcpy( target.ram, current.ram, DS1302_DRIFT_RAM_SIZE );
+    }
+    clock_changed = ds1302_image_clock( current.clock, image, flags, target.clock );
+
+    for( uint8_t i=0; i<31; i++ ){
+        if( target.ram[i] != current.ram[i] ){
+            ram_changed++;
+            ram_last = i;
+        }
+    }
+    if(
+        !ram_changed
+        && !clock_changed
+        && target.trickle_charger == current.trickle_charger
+        && target.clock[7] == ( current.clock[7] & 0x80 )
+    ){
+        return 0;
+    }
+
+    /// Nothing can be written while write protect is on:
+    wp = current.clock[7] & 0x80;
+    if( wp ){
+        ds1302_write_command( device, 0x8e, 0x00 );
+        wp = 0;
+        transactions++;
+    }
+
+    if( target.trickle_charger != current.trickle_charger ){
+        ds1302_write_command( device, 0x90, target.trickle_charger );
+        transactions++;
+    }
+
+    /// A RAM burst may stop after the last changed byte:
+    if( ram_changed && 1 + ram_last + 1 <= 2 * ram_changed ){
+        ds1302_write_burst( device, DS1302_RAM_BURST, target.ram, ram_last + 1 );
+        transactions++;
+    } else {
+        for( uint8_t i=0; i<31; i++ ){
+            if( target.ram[i] != current.ram[i] ){
+                ds1302_write_command( device, 0xc0 + ( i << 1 ), target.ram[i] );
+                transactions++;
+            }
+        }
+    }
+
+    /// The time to keep or set must not predate the writes above:
+    if( transactions && ( flags & ( DS1302_IMAGE_KEEP_TIME | DS1302_IMAGE_SET_NOW ))){
+        ds1302_read_burst( device, DS1302_CLOCK_BURST, current.clock, 7 );
+        clock_changed = ds1302_image_clock( current.clock, image, flags, target.clock );
+    }
+
+    /// A clock burst always writes all 8 registers, control last. Time fields
+    /// are never split over several transactions, and a kept time is always
+    /// written back whole, so they cannot roll over in between:
+    if( clock_changed > 1 || ( clock_changed && ( flags & DS1302_IMAGE_KEEP_TIME ))){
+        ds1302_write_burst( device, DS1302_CLOCK_BURST, target.clock, 8 );
+        wp = target.clock[7];
+        transactions++;
+    } else if( clock_changed ){
+        for( uint8_t i=0; i<7; i++ ){
+            if( target.clock[i] != current.clock[i] ){
+                ds1302_write_command( device, 0x80 + ( i << 1 ), target.clock[i] );
+                transactions++;
+            }
+        }
+    }
+
+    if( wp != target.clock[7] ){
+        ds1302_write_command( device, 0x8e, target.clock[7] );
+        transactions++;
+    }
+
+    /// Time fields may tick after writing, so only settings are checked:
+    ds1302_read_image( device, &check );
+    if( check.clock[7] != target.clock[7] ){
+        printf( "Values don't match: 0x%x != 0x%x\n", target.clock[7], check.clock[7] );
+    }
+    if( check.trickle_charger != target.trickle_charger ){
+        printf( "Values don't match: 0x%x != 0x%x\n", target.trickle_charger, check.trickle_charger );
+    }
+    for( uint8_t i=0; i<31; i++ ){
+        if( check.ram[i] != target.ram[i] ){
+            printf( "Values don't match: 0x%x != 0x%x\n", target.ram[i], check.ram[i] );
+        }
+    }
+
+    return transactions;
+}
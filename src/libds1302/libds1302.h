@@ -34,6 +34,20 @@
 
 /// Defines --------------------------------------------------------------------
 
+/// Burst mode commands (write form, OR with 0x01 to read):
+#define DS1302_CLOCK_BURST  0xBE
+#define DS1302_RAM_BURST    0xFE
+
+/// Flags for ds1302_apply_image() (without either, the time saved in the image is written):
+#define DS1302_IMAGE_KEEP_TIME      0x01    /// Keep the current date and time
+#define DS1302_IMAGE_SET_NOW        0x02    /// Set date and time from the system clock (UTC)
+
+/// Battery-backed RAM bytes 0 .. DS1302_DRIFT_RAM_SIZE - 1 hold the drift record
+/// (always at the start of RAM, so it can be read and written in one burst).
+/// ds1302_write_drift() only overwrites them unforced when they hold a record
+/// or are all zero:
+#define DS1302_DRIFT_RAM_SIZE       10
+
 /// Create the variable `ds1302_device`:
 #define DS1302_setup(...) ds1302_device ds1302_device = ds1302_setup( __VA_ARGS__ )
 
@@ -51,6 +65,10 @@
 #define DS1302_read_command(...) ds1302_read_command( ds1302_device, __VA_ARGS__ )
 #define DS1302_write_command(...) ds1302_write_command( ds1302_device, __VA_ARGS__ )
 #define DS1302_write_and_check(...) ds1302_write_and_check( ds1302_device, __VA_ARGS__ )
+#define DS1302_read_burst(...) ds1302_read_burst( ds1302_device, __VA_ARGS__ )
+#define DS1302_write_burst(...) ds1302_write_burst( ds1302_device, __VA_ARGS__ )
+#define DS1302_read_ram(...) ds1302_read_ram( ds1302_device, __VA_ARGS__ )
+#define DS1302_write_ram(...) ds1302_write_ram( ds1302_device, __VA_ARGS__ )
 
 #define DS1302_read_seconds() ds1302_read_seconds( ds1302_device )
 #define DS1302_read_minutes() ds1302_read_minutes( ds1302_device )
@@ -63,6 +81,8 @@
 #define DS1302_read_24h_mode() ds1302_read_24h_mode( ds1302_device )
 #define DS1302_read_pm() ds1302_read_pm( ds1302_device )
 #define DS1302_read_write_protect() ds1302_read_write_protect( ds1302_device )
+#define DS1302_read_date(...) ds1302_read_date( ds1302_device, __VA_ARGS__ )
+#define DS1302_read_date_ex(...) ds1302_read_date_ex( ds1302_device, __VA_ARGS__ )
 
 #define DS1302_write_seconds(...) ds1302_write_seconds( ds1302_device, __VA_ARGS__ )
 #define DS1302_write_minutes(...) ds1302_write_minutes( ds1302_device, __VA_ARGS__ )
@@ -75,8 +95,18 @@
 #define DS1302_write_write_protect(...) ds1302_write_write_protect( ds1302_device, __VA_ARGS__ )
 
 #define DS1302_write_date(...) ds1302_write_date( ds1302_device, __VA_ARGS__ )
+#define DS1302_write_date_burst(...) ds1302_write_date_burst( ds1302_device, __VA_ARGS__ )
 #define DS1302_print_date() ds1302_print_date( ds1302_device )
 
+#define DS1302_read_drift(...) ds1302_read_drift( ds1302_device, __VA_ARGS__ )
+#define DS1302_drift_ram_free() ds1302_drift_ram_free( ds1302_device )
+#define DS1302_write_drift(...) ds1302_write_drift( ds1302_device, __VA_ARGS__ )
+#define DS1302_measure_drift(...) ds1302_measure_drift( ds1302_device, __VA_ARGS__ )
+#define DS1302_read_corrected_time() ds1302_read_corrected_time( ds1302_device )
+
+#define DS1302_read_image(...) ds1302_read_image( ds1302_device, __VA_ARGS__ )
+#define DS1302_apply_image(...) ds1302_apply_image( ds1302_device, __VA_ARGS__ )
+
 /// These aliases are not necessary, but kept for consistency:
 #define DS1302_decode_value ds1302_decode_value
 #define DS1302_encode_value ds1302_encode_value
@@ -87,10 +117,24 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <wiringPi.h>
 
 
+/// Enums ----------------------------------------------------------------------
+
+/// Signals recorded by the bus trace (build with -DDS1302_TRACE):
+enum ds1302_trace_signal {
+
+    DS1302_TRACE_CE,
+    DS1302_TRACE_CLK,
+    DS1302_TRACE_DAT,
+    DS1302_TRACE_DAT_DIR,       /// 1 = output, 0 = input
+    DS1302_TRACE_DAT_SAMPLE     /// Value read from the data line
+};
+
+
 /// Structs --------------------------------------------------------------------
 
 typedef struct ds1302_device {
@@ -98,8 +142,58 @@ typedef struct ds1302_device {
     uint8_t clk_pin	;
     uint8_t dat_pin	;
     uint8_t ce_pin	;
+    uint8_t votes   ;   /// Copies of every read to vote on: 1 (off), 2 or 3
 } ds1302_device;
 
+/// Read integrity counters (see ds1302_set_votes). They and the previous clock
+/// sample used by the plausibility check are kept per process, shared by all
+/// devices:
+typedef struct ds1302_integrity {
+
+    uint32_t    reads           ;   /// Voted reads
+    uint32_t    disagreements   ;   /// Voted reads where copies differed
+    uint32_t    corrected_bits  ;   /// Bits where copies differed
+    uint32_t    implausible     ;   /// Clock samples out of range or out of sequence
+    uint8_t     confident       ;   /// Last read: copies agreed and sample was plausible
+} ds1302_integrity;
+
+/// All clock fields, as read from one burst transaction:
+typedef struct ds1302_date {
+
+    uint8_t year        ;
+    uint8_t month       ;
+    uint8_t mday        ;
+    uint8_t hours       ;   /// Always 0-23, also when the chip is in 12h mode
+    uint8_t minutes     ;
+    uint8_t seconds     ;
+    uint8_t weekday     ;
+    uint8_t clock_halt  ;
+} ds1302_date;
+
+/// Host-clock correlation of one read transaction (CLOCK_MONOTONIC_RAW):
+typedef struct ds1302_timing {
+
+    struct timespec ce_asserted     ;   /// CE went high
+    struct timespec command_sent    ;   /// Command byte done, registers latched
+    int64_t         duration_ns     ;   /// CE high to the end of the first frame read
+    uint8_t         stretched       ;   /// duration_ns exceeded the threshold
+} ds1302_timing;
+
+/// All registers of the chip, as raw register values:
+typedef struct ds1302_image {
+
+    uint8_t clock[8]        ;   /// Clock burst order, [7] is the control (write protect) register
+    uint8_t trickle_charger ;
+    uint8_t ram[31]         ;
+} ds1302_image;
+
+/// Clock drift correction, stored in the chip RAM:
+typedef struct ds1302_drift {
+
+    int32_t     ppb     ;   /// RTC rate error in parts per billion (> 0: RTC runs fast)
+    uint32_t    epoch   ;   /// Unix time when the clock was last set (0 = unknown)
+} ds1302_drift;
+
 
 /// Functions ------------------------------------------------------------------
 
@@ -134,6 +228,18 @@ extern "C" {
                         uint8_t command,
                         uint8_t value
                     );
+    extern uint8_t  ds1302_read_burst(
+                        ds1302_device d,
+                        uint8_t command,
+                        uint8_t *buffer,
+                        uint8_t length
+                    );
+    extern uint8_t  ds1302_write_burst(
+                        ds1302_device d,
+                        uint8_t command,
+                        const uint8_t *buffer,
+                        uint8_t length
+                    );
 
     extern uint8_t  ds1302_check_range(
                         uint8_t min,
@@ -141,6 +247,10 @@ extern "C" {
                         uint8_t value
                     );
     extern ds1302_device    ds1302_check_device( ds1302_device d );
+    extern ds1302_device    ds1302_set_votes(   ds1302_device d,    uint8_t votes );
+
+    extern void     ds1302_read_integrity(  ds1302_integrity *stats );
+    extern void     ds1302_reset_integrity( void );
 
     extern uint8_t	ds1302_decode_value(
                         uint8_t value,
@@ -165,6 +275,13 @@ extern "C" {
     extern uint8_t	ds1302_read_24h_mode(	    ds1302_device d );
     extern uint8_t	ds1302_read_pm(		        ds1302_device d );
     extern uint8_t	ds1302_read_write_protect(	ds1302_device d );
+    extern uint8_t  ds1302_read_date(           ds1302_device d,    ds1302_date *date );
+    extern uint8_t  ds1302_read_date_ex(
+                        ds1302_device d,
+                        ds1302_date *date,
+                        ds1302_timing *timing,
+                        int64_t threshold_ns    /// 0: 1 ms
+                    );
 
     extern uint8_t	ds1302_write_seconds(       ds1302_device d,    uint8_t seconds );
     extern uint8_t	ds1302_write_minutes(       ds1302_device d,    uint8_t minutes );
@@ -185,6 +302,43 @@ extern "C" {
                         uint8_t minutes,
                         uint8_t seconds
                     );
+    extern uint8_t  ds1302_write_date_burst(    ds1302_device d,    const ds1302_date *date );
+
+    extern uint8_t  ds1302_read_ram(            ds1302_device d,    uint8_t address );
+    extern uint8_t  ds1302_write_ram(
+                        ds1302_device d,
+                        uint8_t address,
+                        uint8_t value
+                    );
+
+    extern time_t   ds1302_date_to_time(        const ds1302_date *date );
+    extern uint8_t  ds1302_read_drift(          ds1302_device d,    ds1302_drift *drift );
+    extern uint8_t  ds1302_drift_ram_free(      ds1302_device d );
+    extern uint8_t  ds1302_write_drift(
+                        ds1302_device d,
+                        const ds1302_drift *drift,
+                        uint8_t force
+                    );
+    extern int32_t  ds1302_measure_drift(
+                        ds1302_device d,
+                        uint32_t samples,
+                        uint32_t interval
+                    );
+    extern time_t   ds1302_read_corrected_time( ds1302_device d );
+
+    extern uint8_t  ds1302_read_image(          ds1302_device d,    ds1302_image *image );
+    extern uint8_t  ds1302_apply_image(
+                        ds1302_device d,
+                        const ds1302_image *image,
+                        uint8_t flags
+                    );
+
+#ifdef DS1302_TRACE
+    extern void     ds1302_trace_record(    uint8_t signal,     uint8_t value );
+    extern uint8_t  ds1302_trace_sample(    uint8_t value );
+    extern void     ds1302_trace_reset(     void );
+    extern int      ds1302_trace_dump_vcd(  FILE *file );
+#endif
 
 #ifdef __cplusplus
 }
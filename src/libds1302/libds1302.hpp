@@ -0,0 +1,254 @@
+/* Copyright (C) 2018 Emilis Dambauskas
+   This file is part of the DS1302 Control Library.
+   Written by Emilis Dambauskas <emilis.d@gmail.com>.
+
+   The DS1302 Control Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The DS1302 Control Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the DS1302 Control Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.
+*/
+
+
+/// Header-only C++ register API.
+///
+/// Every register field is a type carrying its address, mask, encoding and
+/// range as compile-time constants, so `read< Field >()` and `write< Field >()`
+/// compile down to one command byte and a few constant shifts:
+///
+///     ds1302_device device = ds1302_setup( 2, 3, 4 );
+///     uint8_t minutes = ds1302::read< ds1302::minutes >( device );
+///     auto [ h, m, s ] = ds1302::read< ds1302::hours, ds1302::minutes, ds1302::seconds >( device );
+///
+/// Reading several fields of the same bank (clock or RAM) uses one burst
+/// transaction whenever that moves fewer bytes than separate reads.
+/// Requires C++17.
+
+/// Begin lib ------------------------------------------------------------------
+
+#ifndef _LIBDS1302_HPP
+#define _LIBDS1302_HPP
+
+
+/// Includes -------------------------------------------------------------------
+
+#include <cstdint>
+#include <tuple>
+
+#include "libds1302.h"
+
+
+namespace ds1302 {
+
+/// Descriptors ----------------------------------------------------------------
+
+/// A register field. `Address` is the write command; `Mask` selects the
+/// field bits; BCD fields are decoded from tens/units nibbles. `Keep` are the
+/// register bits preserved when the field is written (by default all others).
+template<
+    uint8_t Address,
+    uint8_t Mask,
+    uint8_t Min,
+    uint8_t Max,
+    bool    Bcd,
+    uint8_t Keep = static_cast< uint8_t >( ~Mask )
+>
+struct field {
+
+    static constexpr uint8_t    address =   Address;
+    static constexpr uint8_t    mask =      Mask;
+    static constexpr uint8_t    min =       Min;
+    static constexpr uint8_t    max =       Max;
+    static constexpr bool       bcd =       Bcd;
+    static constexpr uint8_t    keep =      Keep;
+
+    /// Lowest set bit of the mask:
+    static constexpr uint8_t    shift = (
+        ( Mask & 0x01 ) ? 0 : ( Mask & 0x02 ) ? 1 : ( Mask & 0x04 ) ? 2 :
+        ( Mask & 0x08 ) ? 3 : ( Mask & 0x10 ) ? 4 : ( Mask & 0x20 ) ? 5 :
+        ( Mask & 0x40 ) ? 6 : 7
+    );
+
+    /// Position in the burst transfer of its bank:
+    static constexpr bool       in_clock_bank = Address >= 0x80 && Address <= 0x8e;
+    static constexpr bool       in_ram_bank =   Address >= 0xc0 && Address <= 0xfc;
+    static constexpr uint8_t    index = (
+        in_clock_bank ? ( Address - 0x80 ) >> 1 :
+        in_ram_bank ? ( Address - 0xc0 ) >> 1 :
+        0xff
+    );
+
+    static_assert(( Address & 0x81 ) == 0x80, "Address must be a write command" );
+    static_assert( Mask != 0, "Mask must select at least one bit" );
+    static_assert( Min <= Max, "Range must not be empty" );
+
+    static constexpr uint8_t decode( uint8_t value ){
+
+        uint8_t bits = ( value & Mask ) >> shift;
+
+        return Bcd ? ( bits >> 4 ) * 10 + ( bits & 0x0f ) : bits;
+    }
+
+    static constexpr uint8_t encode( uint8_t value ){
+
+        uint8_t bits = Bcd ? (( value / 10 ) << 4 ) | ( value % 10 ) : value;
+
+        return ( bits << shift ) & Mask;
+    }
+};
+
+/// Clock registers:
+using seconds =         field< 0x80, 0x7f,  0, 59,  true >;
+using clock_halt =      field< 0x80, 0x80,  0, 1,   false >;
+using minutes =         field< 0x82, 0x7f,  0, 59,  true >;
+/// 24h mode only: writing hours switches the chip to 24h mode (as the C API
+/// does); reading them while the chip is in 12h mode gives no valid value.
+using hours =           field< 0x84, 0x3f,  0, 23,  true,   0x00 >;
+using pm =              field< 0x84, 0x20,  0, 1,   false >;    /// 12h mode
+using mode_12h =        field< 0x84, 0x80,  0, 1,   false >;
+using mday =            field< 0x86, 0x3f,  1, 31,  true >;
+using month =           field< 0x88, 0x1f,  1, 12,  true >;
+using weekday =         field< 0x8a, 0x07,  1, 7,   true >;
+using year =            field< 0x8c, 0xff,  0, 99,  true >;
+using write_protect =   field< 0x8e, 0x80,  0, 1,   false >;
+using trickle_charger = field< 0x90, 0xff,  0, 255, false >;
+
+/// Battery-backed RAM bytes 0-30:
+template< uint8_t Address >
+struct ram_byte {
+
+    /// Address 31 would be the RAM burst command:
+    static_assert( Address <= 30, "RAM address out of range (should be 0..30)" );
+
+    using type =        field< 0xc0 + ( Address << 1 ), 0xff, 0, 255, false >;
+};
+
+template< uint8_t Address >
+using ram =             typename ram_byte< Address >::type;
+
+
+/// Helpers --------------------------------------------------------------------
+
+namespace detail {
+
+    template< typename... Fields >
+    constexpr uint8_t max_index(){
+
+        uint8_t result = 0;
+        (( result = Fields::index > result ? Fields::index : result ), ... );
+        return result;
+    }
+
+    template< typename... Fields >
+    constexpr uint8_t distinct_registers(){
+
+        constexpr uint8_t addresses[] = { Fields::address... };
+        uint8_t count = 0;
+
+        for( uint8_t i=0; i<sizeof...( Fields ); i++ ){
+            bool seen = false;
+            for( uint8_t j=0; j<i; j++ ){
+                seen = seen || addresses[j] == addresses[i];
+            }
+            count += !seen;
+        }
+        return count;
+    }
+
+    /// One burst of (command + max_index + 1) bytes against two bytes per register:
+    template< typename... Fields >
+    constexpr bool use_burst(){
+
+        constexpr bool clock = ( Fields::in_clock_bank && ... );
+        constexpr bool ram = ( Fields::in_ram_bank && ... );
+
+        return ( clock || ram )
+            && 1 + max_index< Fields... >() + 1 <= 2 * distinct_registers< Fields... >();
+    }
+
+    template< typename Field >
+    uint8_t checked( uint8_t value ){
+
+        if constexpr ( Field::min > 0 || Field::max < ( Field::mask >> Field::shift )){
+            ds1302_check_range( Field::min, Field::max, value );
+        }
+        return value;
+    }
+}
+
+
+/// Functions ------------------------------------------------------------------
+
+template< typename Field >
+uint8_t read( ds1302_device device ){
+
+    return detail::checked< Field >(
+        Field::decode( ds1302_read_command( device, Field::address | 0x01 ))
+    );
+}
+
+template< typename First, typename Second, typename... Rest >
+std::tuple< uint8_t, uint8_t, decltype( Rest::decode( 0 ))... > read( ds1302_device device ){
+
+    if constexpr ( detail::use_burst< First, Second, Rest... >() ){
+
+        constexpr uint8_t length = detail::max_index< First, Second, Rest... >() + 1;
+        constexpr uint8_t command = First::in_clock_bank ? DS1302_CLOCK_BURST : DS1302_RAM_BURST;
+        uint8_t registers[ length ];
+
+        ds1302_read_burst( device, command, registers, length );
+
+        return {
+            detail::checked< First >( First::decode( registers[ First::index ] )),
+            detail::checked< Second >( Second::decode( registers[ Second::index ] )),
+            detail::checked< Rest >( Rest::decode( registers[ Rest::index ] ))...
+        };
+    } else {
+        return {
+            read< First >( device ),
+            read< Second >( device ),
+            read< Rest >( device )...
+        };
+    }
+}
+
+template< typename Field >
+uint8_t write( ds1302_device device, uint8_t value ){
+
+    uint8_t other_bits = 0;
+
+    detail::checked< Field >( value );
+
+    /// Keep the bits of other fields sharing the register:
+    if constexpr ( Field::keep != 0 ){
+        other_bits = ds1302_read_command( device, Field::address | 0x01 ) & Field::keep;
+    }
+
+    ds1302_write_and_check( device, Field::address, other_bits | Field::encode( value ));
+
+    return value;
+}
+
+} // namespace ds1302
+
+
+/// End of lib -----------------------------------------------------------------
+
+#endif // _LIBDS1302_HPP
@@ -0,0 +1,341 @@
+/* Copyright (C) 2018 Emilis Dambauskas
+   This file is part of the DS1302 Control Library.
+   Written by Emilis Dambauskas <emilis.d@gmail.com>.
+
+   The DS1302 Control Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The DS1302 Control Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the DS1302 Control Library; if not, see
+   <http://www.gnu.org/licenses/>.
+
+   As a special exception, if you link the code in this file with
+   files compiled with a GNU compiler to produce an executable,
+   that does not cause the resulting executable to be covered by
+   the GNU Lesser General Public License.  This exception does not
+   however invalidate any other reasons why the executable file
+   might be covered by the GNU Lesser General Public License.
+   This exception applies to code released by its copyright holders
+   in files containing the exception.
+*/
+
+/// Header-only variant of the library for fixed wiring.
+///
+/// Pin numbers and bus timing are compile-time constants, and the pins are
+/// driven through the BCM283x GPIO registers (mapped from /dev/gpiomem)
+/// instead of wiringPi, so every transaction inlines into straight-line code.
+///
+/// Usage (one wiring per translation unit):
+///
+///     #define DS1302_FIXED_CLK_PIN 2
+///     #define DS1302_FIXED_DAT_PIN 3
+///     #define DS1302_FIXED_CE_PIN  4
+///     #include "libds1302_fixed.h"
+///
+///     ds1302_fixed_setup();
+///     uint8_t seconds = ds1302_fixed_read_command( 0x81 );
+
+/// Begin lib ------------------------------------------------------------------
+
+#ifndef _LIBDS1302_FIXED_H
+#define _LIBDS1302_FIXED_H
+
+
+/// Defines --------------------------------------------------------------------
+
+/// Wiring (BCM GPIO numbers), same defaults as the `ds1302` utility:
+
+#ifndef DS1302_FIXED_CLK_PIN
+#define DS1302_FIXED_CLK_PIN    2
+#endif
+#ifndef DS1302_FIXED_DAT_PIN
+#define DS1302_FIXED_DAT_PIN    3
+#endif
+#ifndef DS1302_FIXED_CE_PIN
+#define DS1302_FIXED_CE_PIN     4
+#endif
+
+/// Bus timing in nanoseconds, DS1302 datasheet worst case (Vcc = 2.0V):
+
+#ifndef DS1302_FIXED_T_CC
+#define DS1302_FIXED_T_CC       4000    /// CE to CLK setup
+#endif
+#ifndef DS1302_FIXED_T_CH
+#define DS1302_FIXED_T_CH       1000    /// CLK high time
+#endif
+#ifndef DS1302_FIXED_T_CL
+#define DS1302_FIXED_T_CL       1000    /// CLK low time
+#endif
+#ifndef DS1302_FIXED_T_CDD
+#define DS1302_FIXED_T_CDD      800     /// CLK to data delay
+#endif
+#ifndef DS1302_FIXED_T_DC
+#define DS1302_FIXED_T_DC       200     /// Data to CLK setup
+#endif
+#ifndef DS1302_FIXED_T_CWH
+#define DS1302_FIXED_T_CWH      4000    /// CE inactive time
+#endif
+
+/// CLK low time on reads also has to cover the CLK to data delay:
+#define DS1302_FIXED_T_READ_LO  ( DS1302_FIXED_T_CL > DS1302_FIXED_T_CDD \
+                                    ? DS1302_FIXED_T_CL : DS1302_FIXED_T_CDD )
+
+/// BCM283x GPIO register word offsets:
+
+#define DS1302_GPFSEL0          0
+#define DS1302_GPSET0           7
+#define DS1302_GPCLR0           10
+#define DS1302_GPLEV0           13
+#define DS1302_GPIO_MAP_SIZE    4096
+
+#define DS1302_FSEL_REG( pin )      ( DS1302_GPFSEL0 + ( pin ) / 10 )
+#define DS1302_FSEL_SHIFT( pin )    ((( pin ) % 10 ) * 3 )
+#define DS1302_PIN_MASK( pin )      ( UINT32_C( 1 ) << ( pin ))
+
+#define FIXED_CE_OFF    ds1302_fixed_gpio[ DS1302_GPCLR0 ] = DS1302_PIN_MASK( DS1302_FIXED_CE_PIN )
+#define FIXED_CE_ON     ds1302_fixed_gpio[ DS1302_GPSET0 ] = DS1302_PIN_MASK( DS1302_FIXED_CE_PIN )
+
+#define FIXED_CLK_HI    ds1302_fixed_gpio[ DS1302_GPSET0 ] = DS1302_PIN_MASK( DS1302_FIXED_CLK_PIN )
+#define FIXED_CLK_LO    ds1302_fixed_gpio[ DS1302_GPCLR0 ] = DS1302_PIN_MASK( DS1302_FIXED_CLK_PIN )
+
+#define FIXED_DAT_HI        ds1302_fixed_gpio[ DS1302_GPSET0 ] = DS1302_PIN_MASK( DS1302_FIXED_DAT_PIN )
+#define FIXED_DAT_INPUT     ds1302_fixed_pin_mode( DS1302_FIXED_DAT_PIN, 0 )
+#define FIXED_DAT_LO        ds1302_fixed_gpio[ DS1302_GPCLR0 ] = DS1302_PIN_MASK( DS1302_FIXED_DAT_PIN )
+#define FIXED_DAT_OUTPUT    ds1302_fixed_pin_mode( DS1302_FIXED_DAT_PIN, 1 )
+#define FIXED_DAT_READ      (( ds1302_fixed_gpio[ DS1302_GPLEV0 ] >> DS1302_FIXED_DAT_PIN ) & 1 )
+
+#define FIXED_DELAY( ns )   ds1302_fixed_delay( ns )
+
+
+/// Includes -------------------------------------------------------------------
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/// Checks ---------------------------------------------------------------------
+
+_Static_assert(
+    DS1302_FIXED_CLK_PIN >= 2 && DS1302_FIXED_CLK_PIN <= 27,
+    "DS1302_FIXED_CLK_PIN out of range (should be 2..27)"
+);
+_Static_assert(
+    DS1302_FIXED_DAT_PIN >= 2 && DS1302_FIXED_DAT_PIN <= 27,
+    "DS1302_FIXED_DAT_PIN out of range (should be 2..27)"
+);
+_Static_assert(
+    DS1302_FIXED_CE_PIN >= 2 && DS1302_FIXED_CE_PIN <= 27,
+    "DS1302_FIXED_CE_PIN out of range (should be 2..27)"
+);
+
+
+/// Variables ------------------------------------------------------------------
+
+static volatile uint32_t *ds1302_fixed_gpio;
+
+
+/// Functions ==================================================================
+
+/// Helpers --------------------------------------------------------------------
+
+static inline void ds1302_fixed_delay( long ns ){
+
+    struct timespec start, now;
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    do {
+        clock_gettime( CLOCK_MONOTONIC, &now );
+    } while(
+        ( now.tv_sec - start.tv_sec ) * 1000000000L
+        + ( now.tv_nsec - start.tv_nsec ) < ns
+    );
+}
+
+static inline void ds1302_fixed_pin_mode( uint8_t pin, uint8_t output ){
+
+    uint32_t fsel = ds1302_fixed_gpio[ DS1302_FSEL_REG( pin ) ];
+
+    fsel &= ~( UINT32_C( 7 ) << DS1302_FSEL_SHIFT( pin ));
+    fsel |= (uint32_t)( output & 1 ) << DS1302_FSEL_SHIFT( pin );
+
+    ds1302_fixed_gpio[ DS1302_FSEL_REG( pin ) ] = fsel;
+}
+
+/// Mode change ----------------------------------------------------------------
+
+static inline void ds1302_fixed_start_transfer( void ){
+
+    FIXED_CE_ON;
+    FIXED_DELAY( DS1302_FIXED_T_CC );
+}
+
+static inline void ds1302_fixed_stop_transfer( void ){
+
+    FIXED_CLK_LO;
+    FIXED_CE_OFF;
+    FIXED_DAT_LO;
+    FIXED_DELAY( DS1302_FIXED_T_CWH );
+}
+
+static inline void ds1302_fixed_start_read( void ){
+
+    FIXED_DAT_INPUT;
+    FIXED_DELAY( DS1302_FIXED_T_CDD );
+}
+
+static inline void ds1302_fixed_start_write( void ){
+
+    FIXED_DAT_OUTPUT;
+}
+
+/// Setup ----------------------------------------------------------------------
+
+static inline void ds1302_fixed_setup( void ){
+
+    int fd = open( "/dev/gpiomem", O_RDWR | O_SYNC | O_CLOEXEC );
+
+    if( fd < 0 ){
+        printf( "ERROR: ds1302_fixed_setup failed to open /dev/gpiomem\n" );
+        exit( 1 );
+    }
+
+    void *map = mmap(
+        NULL,
+        DS1302_GPIO_MAP_SIZE,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED,
+        fd,
+        0
+    );
+    close( fd );
+
+    if( map == MAP_FAILED ){
+        printf( "ERROR: ds1302_fixed_setup failed to map /dev/gpiomem\n" );
+        exit( 1 );
+    }
+
+    ds1302_fixed_gpio = (volatile uint32_t *)map;
+
+    ds1302_fixed_pin_mode( DS1302_FIXED_CLK_PIN, 1 );
+    ds1302_fixed_pin_mode( DS1302_FIXED_DAT_PIN, 1 );
+    ds1302_fixed_pin_mode( DS1302_FIXED_CE_PIN,  1 );
+
+    ds1302_fixed_stop_transfer();
+}
+
+/// Low-level ------------------------------------------------------------------
+
+static inline uint8_t ds1302_fixed_write_bit( uint8_t bit ){
+
+    if( bit ){
+        FIXED_DAT_HI;
+    } else {
+        FIXED_DAT_LO;
+    }
+    FIXED_DELAY( DS1302_FIXED_T_DC );
+    FIXED_CLK_HI;
+    FIXED_DELAY( DS1302_FIXED_T_CH );
+    FIXED_DAT_LO;
+    FIXED_CLK_LO;
+    FIXED_DELAY( DS1302_FIXED_T_CL );
+
+    return bit;
+}
+
+static inline uint8_t ds1302_fixed_read_bit( void ){
+
+    uint8_t bit = FIXED_DAT_READ;
+
+    FIXED_CLK_HI;
+    FIXED_DELAY( DS1302_FIXED_T_CH );
+    FIXED_CLK_LO;
+    FIXED_DELAY( DS1302_FIXED_T_READ_LO );
+
+    return bit;
+}
+
+static inline uint8_t ds1302_fixed_write_byte( uint8_t byte ){
+
+    for( uint8_t i=0; i<8; i++ ){
+        ds1302_fixed_write_bit(( byte >> i ) & 1 );
+    }
+
+    return byte;
+}
+
+static inline uint8_t ds1302_fixed_read_byte( void ){
+
+    uint8_t byte = 0;
+
+    for( uint8_t i=0; i<8; i++ ){
+        byte |= ds1302_fixed_read_bit() << i;
+    }
+
+    return byte;
+}
+
+/// Command functions ----------------------------------------------------------
+
+static inline uint8_t ds1302_fixed_read_command( uint8_t command ){
+
+    uint8_t value;
+
+    ds1302_fixed_start_transfer();
+    ds1302_fixed_start_write();
+
+    ds1302_fixed_write_byte( command | 0x01 );
+    ds1302_fixed_start_read();
+
+    value = ds1302_fixed_read_byte();
+
+    ds1302_fixed_stop_transfer();
+
+    return value;
+}
+
+static inline uint8_t ds1302_fixed_write_command( uint8_t command, uint8_t value ){
+
+    ds1302_fixed_start_transfer();
+    ds1302_fixed_start_write();
+
+    ds1302_fixed_write_byte( command & 0xFE );
+    ds1302_fixed_write_byte( value );
+
+    ds1302_fixed_stop_transfer();
+
+    return value;
+}
+
+static inline uint8_t ds1302_fixed_read_burst( uint8_t command, uint8_t *buffer, uint8_t length ){
+
+    ds1302_fixed_start_transfer();
+    ds1302_fixed_start_write();
+
+    ds1302_fixed_write_byte( command | 0x01 );
+    ds1302_fixed_start_read();
+
+    for( uint8_t i=0; i<length; i++ ){
+        buffer[i] = ds1302_fixed_read_byte();
+    }
+
+    ds1302_fixed_stop_transfer();
+
+    return length;
+}
+
+
+/// End of lib -----------------------------------------------------------------
+
+#endif // _LIBDS1302_FIXED_H